@@ -0,0 +1,303 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "cllCull.h"
+
+#include <algorithm>
+
+#include "cllUtil.h"
+
+namespace cll {
+
+namespace {
+
+enum DENSITY_ARGS {
+    D_POS,
+    D_MVP,
+    D_SLACK,
+    D_GRID,
+    D_CELLS
+};
+
+//cl_cull_count shares the first arguments with cl_cull, OFFSETS is its output
+enum ARGS {
+    POS,
+    MVP,
+    SLACK,
+    GRID,
+    CELLS,
+    CAP,
+    N,
+    SCAN,
+    OFFSETS,
+    INDICES
+};
+
+enum OFFSETS_ARGS {
+    O_OFFSETS,
+    O_GROUPS,
+    O_SCAN,
+    O_COUNT
+};
+
+}
+
+const std::string Cull::density_name("cl_density");
+const std::string Cull::count_name("cl_cull_count");
+const std::string Cull::offsets_name("cl_cull_offsets");
+const std::string Cull::name("cl_cull");
+const char* const Cull::source = TOSTRING(
+float4 cll_project(float16 m, float4 p)
+{
+    return m.s0123*p.x + m.s4567*p.y + m.s89ab*p.z + m.scdef*p.w;
+}
+
+//density cell of a clip space position, -1 if it is outside the frustum
+int cll_cull_cell(float4 clip, float slack, unsigned int grid)
+{
+    float w = clip.w;
+    if(w <= 0.f)
+        return -1;
+    float lim = w*(1.f + slack);
+    if(fabs(clip.x) > lim || fabs(clip.y) > lim || clip.z < -w || clip.z > w)
+        return -1;
+    float2 cell = (clip.xy/w*0.5f + 0.5f)*(float)grid;
+    int cx = clamp((int)cell.x, 0, (int)grid-1);
+    int cy = clamp((int)cell.y, 0, (int)grid-1);
+    return cy*(int)grid + cx;
+}
+
+__kernel void cl_density(__global const float4* pos,
+                         float16 mvp,
+                         float slack,
+                         unsigned int grid,
+                         __global unsigned int* cells)
+{
+    unsigned int i = get_global_id(0);
+    int c = cll_cull_cell(cll_project(mvp, pos[i]), slack, grid);
+    if(c >= 0)
+        atomic_inc(&cells[c]);
+}
+
+unsigned int cll_cull_keep(__global const float4* pos,
+                           unsigned int i,
+                           unsigned int n,
+                           float16 mvp,
+                           float slack,
+                           unsigned int grid,
+                           __global const unsigned int* cells,
+                           float cap)
+{
+    if(i >= n)
+        return 0;
+    int c = cll_cull_cell(cll_project(mvp, pos[i]), slack, grid);
+    if(c < 0)
+        return 0;
+    if(cap <= 0.f)
+        return 1;
+    //hash of the index, so the same particles stay selected from frame to frame
+    float u = (float)(cll_hash(i) >> 8) * (1.f/16777216.f);
+    return u*(float)cells[c] < cap;
+}
+
+//inclusive scan of v over the work group, scan[get_local_size(0)-1] holds the total.
+//every work item has to get here
+unsigned int cll_scan(__local unsigned int* scan, unsigned int v)
+{
+    unsigned int lid = get_local_id(0);
+    scan[lid] = v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(unsigned int off = 1; off < get_local_size(0); off <<= 1)
+    {
+        unsigned int t = lid >= off ? scan[lid - off] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scan[lid] += t;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    return scan[lid];
+}
+
+__kernel void cl_cull_count(__global const float4* pos,
+                            float16 mvp,
+                            float slack,
+                            unsigned int grid,
+                            __global const unsigned int* cells,
+                            float cap,
+                            unsigned int n,
+                            __local unsigned int* scan,
+                            __global unsigned int* totals)
+{
+    unsigned int keep = cll_cull_keep(pos, get_global_id(0), n, mvp, slack, grid, cells, cap);
+    cll_scan(scan, keep);
+    if(get_local_id(0) == 0)
+        totals[get_group_id(0)] = scan[get_local_size(0)-1];
+}
+
+//a single work group turns the per group totals into offsets, in place
+__kernel void cl_cull_offsets(__global unsigned int* offsets,
+                              unsigned int groups,
+                              __local unsigned int* scan,
+                              __global unsigned int* count)
+{
+    unsigned int lid = get_local_id(0);
+    unsigned int size = get_local_size(0);
+    unsigned int carry = 0;
+    for(unsigned int base = 0; base < groups; base += size)
+    {
+        unsigned int g = base + lid;
+        unsigned int v = g < groups ? offsets[g] : 0;
+        unsigned int inc = cll_scan(scan, v);
+        if(g < groups)
+            offsets[g] = carry + inc - v;
+        carry += scan[size-1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if(lid == 0)
+        count[0] = carry;
+}
+
+__kernel void cl_cull(__global const float4* pos,
+                      float16 mvp,
+                      float slack,
+                      unsigned int grid,
+                      __global const unsigned int* cells,
+                      float cap,
+                      unsigned int n,
+                      __local unsigned int* scan,
+                      __global const unsigned int* offsets,
+                      __global unsigned int* indices)
+{
+    unsigned int i = get_global_id(0);
+    unsigned int keep = cll_cull_keep(pos, i, n, mvp, slack, grid, cells, cap);
+    unsigned int inc = cll_scan(scan, keep);
+    if(keep)
+        indices[offsets[get_group_id(0)] + inc - 1] = i;
+}
+);
+
+Cull::Cull()
+    : enabled(false),
+      mvp({{1.f, 0.f, 0.f, 0.f,
+            0.f, 1.f, 0.f, 0.f,
+            0.f, 0.f, 1.f, 0.f,
+            0.f, 0.f, 0.f, 1.f}}),
+      slack(0.f),
+      cap(0.f),
+      grid(DEFAULT_GRID),
+      m_count_host(0)
+{
+}
+
+void
+Cull::load(ExecutorBundle& bundle, cl_uint nmax)
+{
+    m_density = cl::Kernel(bundle.program, density_name.c_str(), NULL);
+    m_count_kernel = cl::Kernel(bundle.program, count_name.c_str(), NULL);
+    m_offsets = cl::Kernel(bundle.program, offsets_name.c_str(), NULL);
+    m_cull = cl::Kernel(bundle.program, name.c_str(), NULL);
+    m_zero.assign(grid*grid, 0);
+    m_cells = cl::Buffer(bundle.context, CL_MEM_READ_WRITE, m_zero.size()*sizeof(cl_uint), NULL, NULL);
+    const cl_uint groups = std::max(1u, (nmax + GROUP-1)/GROUP);
+    m_group_offsets = cl::Buffer(bundle.context, CL_MEM_READ_WRITE, groups*sizeof(cl_uint), NULL, NULL);
+    m_count = cl::Buffer(bundle.context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+}
+
+void
+Cull::exec(ExecutorBundle& bundle, const cl::Memory& pos, const cl::Memory& indices,
+           const cl::Memory* draw, cl_uint n, const std::vector<cl::Event>* wait, cl::Event* done)
+{
+    //in order queue, so only the first kernel needs the wait list
+    if(cap > 0.f)
+    {
+        bundle.queue.enqueueWriteBuffer(m_cells, CL_FALSE, 0, m_zero.size()*sizeof(cl_uint), m_zero.data());
+        m_density.setArg(D_POS, pos);
+        m_density.setArg(D_MVP, mvp);
+        m_density.setArg(D_SLACK, slack);
+        m_density.setArg(D_GRID, grid);
+        m_density.setArg(D_CELLS, m_cells);
+        bundle.queue.enqueueNDRangeKernel(m_density,
+                                          cl::NullRange,
+                                          cl::NDRange(n),
+                                          cl::NullRange,
+                                          wait,
+                                          NULL);
+    }
+
+    //count per group, scan the counts, then scatter. unlike one atomic slot
+    //per group this keeps the survivors in index order
+    const cl_uint groups = std::max(1u, (n + GROUP-1)/GROUP);
+    cl::Kernel* passes[] = { &m_count_kernel, &m_cull };
+    for(unsigned int k=0; k<2; ++k)
+    {
+        cl::Kernel& kernel = *passes[k];
+        kernel.setArg(POS, pos);
+        kernel.setArg(MVP, mvp);
+        kernel.setArg(SLACK, slack);
+        kernel.setArg(GRID, grid);
+        kernel.setArg(CELLS, m_cells);
+        kernel.setArg(CAP, cap);
+        kernel.setArg(N, n);
+        kernel.setArg(SCAN, cl::__local(GROUP*sizeof(cl_uint)));
+        kernel.setArg(OFFSETS, m_group_offsets);
+    }
+    m_cull.setArg(INDICES, indices);
+
+    m_offsets.setArg(O_OFFSETS, m_group_offsets);
+    m_offsets.setArg(O_GROUPS, groups);
+    m_offsets.setArg(O_SCAN, cl::__local(GROUP*sizeof(cl_uint)));
+    if(draw)
+        m_offsets.setArg(O_COUNT, *draw);
+    else
+        m_offsets.setArg(O_COUNT, m_count);
+
+    bundle.queue.enqueueNDRangeKernel(m_count_kernel,
+                                      cl::NullRange,
+                                      cl::NDRange(groups*GROUP),
+                                      cl::NDRange(GROUP),
+                                      wait,
+                                      NULL);
+    bundle.queue.enqueueNDRangeKernel(m_offsets,
+                                      cl::NullRange,
+                                      cl::NDRange(GROUP),
+                                      cl::NDRange(GROUP),
+                                      NULL,
+                                      NULL);
+    bundle.queue.enqueueNDRangeKernel(m_cull,
+                                      cl::NullRange,
+                                      cl::NDRange(groups*GROUP),
+                                      cl::NDRange(GROUP),
+                                      NULL,
+                                      done);
+}
+
+cl_uint
+Cull::count(ExecutorBundle& bundle)
+{
+    bundle.queue.enqueueReadBuffer(m_count, CL_TRUE, 0, sizeof(cl_uint), &m_count_host);
+    return m_count_host;
+}
+
+}
@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#ifndef CLLCULL_H
+#define CLLCULL_H
+
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "cllExecutor.h"
+
+namespace cll {
+
+// device side visibility pass. particles outside the view frustum are dropped
+// and the survivors' indices are compacted into an element buffer for
+// glDrawElements. with a cap set, screen cells holding more particles than can
+// be told apart are thinned out to about cap particles (density lod).
+// the compaction is a scan, so the indices stay in ascending order and the
+// blended points are drawn in the same order every frame.
+class Cull : boost::noncopyable
+{
+public:
+    // needs cll_hash, so it has to follow Seed::source in a program
+    static const char* const source;
+    static const std::string density_name;
+    static const std::string count_name;
+    static const std::string offsets_name;
+    static const std::string name;
+    static const cl_uint DEFAULT_GRID = 64;
+    static const cl_uint GROUP = 128; //work group size of the scans
+
+    Cull();
+
+    // program must have been built from a source containing Cull::source.
+    // nmax bounds n of exec
+    void load(ExecutorBundle& bundle, cl_uint nmax);
+
+    // pos, indices and draw must be acquired. the kernels wait for wait, done is
+    // signaled once the index buffer is written. if draw is given the count goes
+    // into the first uint of that DrawElementsIndirectCommand and stays on the
+    // device, otherwise it is kept for count().
+    void exec(ExecutorBundle& bundle, const cl::Memory& pos, const cl::Memory& indices,
+              const cl::Memory* draw, cl_uint n, const std::vector<cl::Event>* wait, cl::Event* done);
+
+    // blocks until the count of exec is available, only if exec had no draw
+    cl_uint count(ExecutorBundle& bundle);
+
+    bool enabled;
+    cl_float16 mvp; //projection * modelview, column major like gl
+    cl_float slack; //frustum growth in ndc, so partially visible points survive
+    cl_float cap; //particles kept per density cell, 0 disables lod
+    cl_uint grid; //density cells per axis
+
+private:
+    cl::Kernel m_density;
+    cl::Kernel m_count_kernel;
+    cl::Kernel m_offsets;
+    cl::Kernel m_cull;
+    cl::Buffer m_cells;
+    cl::Buffer m_group_offsets; //kept particles per group, then where each group starts
+    cl::Buffer m_count;
+    std::vector<cl_uint> m_zero;
+    cl_uint m_count_host;
+};
+
+}
+
+#endif
@@ -52,6 +52,7 @@ struct ExecutorBundle
     cl::Program program;
     cl::Kernel kernel;
     unsigned int deviceUsed;
+    bool owns_gl; //created on the gl thread, so it may sync with gl itself
 };
 
 template<typename T>
@@ -68,6 +69,14 @@ public:
     void load(typename T::data_t& data) { m_load_func(bundle, data); }
     void load(std::tr1::shared_ptr<typename T::data_t> data) { m_load_func(bundle, *data); }
 
+    // run on another bundle, e.g. one returned by fork()
+    void exec(ExecutorBundle& b, typename T::data_t& data) const { m_exec_func(b, data); }
+
+    // own queue and kernel on the same context and program, for use from
+    // another thread. the fork does not own gl, whoever drives it has to
+    // glFinish before submitting work on shared buffers.
+    ExecutorBundle fork() const;
+
     void set_exec_func(const strategy_func_t& e) { m_exec_func = e; }
     void set_load_func(const strategy_func_t& l) { m_load_func = l; }
 
@@ -90,6 +99,7 @@ Executor<T>::Executor()
 
         //atm first device of first platform is used... yeah
         bundle.deviceUsed = 0;
+        bundle.owns_gl = true;
         std::vector<cl::Device> devices;
         platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
         std::cout << "devices.size(): " << devices.size() << std::endl;
@@ -122,6 +132,25 @@ Executor<T>::Executor()
     }
 }
 
+template<typename T>
+ExecutorBundle Executor<T>::fork() const
+{
+    ExecutorBundle b;
+    b.context = bundle.context;
+    b.program = bundle.program;
+    b.deviceUsed = bundle.deviceUsed;
+    b.owns_gl = false;
+    try{
+        std::vector<cl::Device> devices = bundle.context.getInfo<CL_CONTEXT_DEVICES>();
+        b.queue = cl::CommandQueue(b.context, devices[b.deviceUsed], 0, 0);
+        b.kernel = cl::Kernel(b.program, T::name.c_str(), 0);
+    }
+    catch (cl::Error er) {
+        std::cout << "ERROR @fork: " << er.what() << " " << ErrorString(er.err()) << std::endl;
+    }
+    return b;
+}
+
 }
 
 #endif
@@ -0,0 +1,150 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#ifndef CLLEXECUTORPOOL_H
+#define CLLEXECUTORPOOL_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "cllExecutor.h"
+#include "cllJobQueue.h"
+
+namespace cll {
+
+// runs many independent data_t concurrently. every worker has its own bundle
+// (queue and kernel forked from one executor, sharing context and program)
+// and takes jobs from a lock free queue.
+template<typename T>
+class ExecutorPool : boost::noncopyable
+{
+public:
+    typedef typename T::data_t data_t;
+
+    // exec must outlive the pool
+    ExecutorPool(const Executor<T>& exec, unsigned int nworkers, std::size_t capacity = 1024);
+    ~ExecutorPool();
+
+    // false if the queue is full. only one job per data_t may be in flight,
+    // and gl has to be finished with its buffers before submitting.
+    bool submit(data_t& data);
+
+    // blocks until every submitted job is done
+    void wait() const;
+
+    unsigned int size() const { return m_threads.size(); }
+
+private:
+    void work(unsigned int id);
+    // yields for the first SPINS idle polls, then sleeps
+    static void backoff(unsigned int idle);
+
+    static const unsigned int SPINS = 64; //idle polls before a thread starts sleeping
+
+    const Executor<T>& m_exec;
+    std::vector<ExecutorBundle> m_bundles;
+    JobQueue<data_t*> m_queue;
+    std::atomic<std::size_t> m_pending;
+    std::atomic<bool> m_quit;
+    std::vector<std::thread> m_threads;
+};
+
+
+template<typename T>
+ExecutorPool<T>::ExecutorPool(const Executor<T>& exec, unsigned int nworkers, std::size_t capacity)
+    : m_exec(exec), m_queue(capacity), m_pending(0), m_quit(false)
+{
+    nworkers = std::max(1u, nworkers);
+    for(unsigned int i=0; i<nworkers; ++i)
+        m_bundles.push_back(m_exec.fork());
+    for(unsigned int i=0; i<nworkers; ++i)
+        m_threads.push_back(std::thread(&ExecutorPool<T>::work, this, i));
+}
+
+template<typename T>
+ExecutorPool<T>::~ExecutorPool()
+{
+    wait();
+    m_quit.store(true, std::memory_order_release);
+    for(unsigned int i=0; i<m_threads.size(); ++i)
+        m_threads[i].join();
+}
+
+template<typename T>
+bool ExecutorPool<T>::submit(data_t& data)
+{
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    if(m_queue.push(&data))
+        return true;
+    m_pending.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+template<typename T>
+void ExecutorPool<T>::wait() const
+{
+    //the device may be busy for most of a frame, don't burn the gl thread's core on it
+    unsigned int idle = 0;
+    while(m_pending.load(std::memory_order_acquire) != 0)
+        backoff(++idle);
+}
+
+template<typename T>
+void ExecutorPool<T>::backoff(unsigned int idle)
+{
+    if(idle < SPINS)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+template<typename T>
+void ExecutorPool<T>::work(unsigned int id)
+{
+    ExecutorBundle& bundle = m_bundles[id];
+    unsigned int idle = 0;
+    while(!m_quit.load(std::memory_order_acquire))
+    {
+        data_t* data = NULL;
+        if(m_queue.pop(data))
+        {
+            m_exec.exec(bundle, *data);
+            m_pending.fetch_sub(1, std::memory_order_release);
+            idle = 0;
+        }
+        else
+            backoff(++idle);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,437 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "cllExport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cllHost.h"
+
+#ifdef CLL_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace cll {
+
+static const GLuint64 WAIT_NS = 1000000000; //only used when draining in the destructor
+static const int SINK_FAILED = -2;
+static const std::chrono::milliseconds OPEN_RETRY(100); //polling for a fifo reader
+
+Exporter::Exporter(const std::string& path, GLsizei nelem, unsigned int every,
+                   unsigned int flags, unsigned int ring)
+    : m_path(path),
+      m_nelem(nelem),
+      m_every(std::max(1u, every)),
+      m_flags(flags),
+      m_enabled(GLEW_ARB_copy_buffer && GLEW_ARB_sync),
+      m_slots(std::max(2u, ring)),
+      m_head(0),
+      m_tail(0),
+      m_step(0),
+      m_fd(-1),
+      m_ready(false),
+      m_stdout(-1),
+      m_encode_ms(0.),
+      m_quit(false),
+      m_raw_bytes(0),
+      m_out_bytes(0),
+      m_repack_bytes(0),
+      m_repack_ms(0.),
+      m_frames(0),
+      m_dropped(0),
+      m_last_report(std::chrono::steady_clock::now())
+{
+    //the staging ring needs gl 3.1 copy buffers and 3.2 fences, the legacy
+    //context glut gives us only has them as extensions
+    if(!m_enabled)
+    {
+        std::cout << "ERROR @Exporter: needs ARB_copy_buffer and ARB_sync, export disabled" << std::endl;
+        return;
+    }
+
+#ifndef CLL_HAVE_LZ4
+    if(m_flags & LZ4)
+    {
+        std::cout << "Exporter: built without lz4, writing uncompressed" << std::endl;
+        m_flags &= ~LZ4;
+    }
+#endif
+
+    if(m_path == "-")
+    {
+        //keep the real stdout for the stream, everything else goes to stderr
+        std::cout.flush();
+        std::fflush(stdout);
+        m_fd = dup(STDOUT_FILENO);
+        m_stdout = dup(STDOUT_FILENO);
+        if(m_fd < 0 || m_stdout < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+        {
+            std::cerr << "ERROR @Exporter: stdout: " << std::strerror(errno) << std::endl;
+            if(m_fd >= 0)
+                close(m_fd);
+            if(m_stdout >= 0)
+                close(m_stdout);
+            m_fd = SINK_FAILED;
+            m_stdout = -1;
+        }
+    }
+
+    for(unsigned int i=0; i<m_slots.size(); ++i)
+    {
+        m_slots[i].buf.reset(new staging_t(nelem));
+        m_slots[i].fence = 0;
+        m_slots[i].mapped = NULL;
+        m_slots[i].step = 0;
+        m_slots[i].st = Slot::FREE;
+    }
+
+    m_thread = std::thread(&Exporter::writer, this);
+}
+
+Exporter::~Exporter()
+{
+    if(!m_enabled)
+        return;
+
+    //map whatever is still being copied and let the writer drain it
+    collect(true);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+    collect(false);
+
+    if(m_stdout >= 0)
+    {
+        std::cout.flush();
+        std::fflush(stdout);
+        dup2(m_stdout, STDOUT_FILENO);
+        close(m_stdout);
+    }
+}
+
+void
+Exporter::step(const std::vector<GLuint>& vbos)
+{
+    if(!m_enabled)
+        return;
+    collect(false);
+
+    const unsigned long long step = m_step++;
+    if(step % m_every != 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Slot& s = m_slots[m_head];
+    if(s.st != Slot::FREE)
+    {
+        //the sink can't keep up, drop rather than stall the simulation
+        ++m_dropped;
+        return;
+    }
+
+    const GLsizeiptr bytes = m_nelem/vbos.size()*sizeof(cl_float4);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s.buf->id());
+    for(unsigned int i=0; i<vbos.size(); ++i)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, vbos[i]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, i*bytes, bytes);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s.step = step;
+    s.st = Slot::COPYING;
+    m_head = (m_head+1) % m_slots.size();
+}
+
+void
+Exporter::collect(bool wait)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for(unsigned int i=0; i<m_slots.size(); ++i)
+    {
+        Slot& s = m_slots[i];
+        if(s.st != Slot::DONE)
+            continue;
+        s.buf->unmap();
+        s.mapped = NULL;
+        s.st = Slot::FREE;
+    }
+
+    //slots are filled round robin, so walking from the tail keeps frames in step order
+    while(m_slots[m_tail].st == Slot::COPYING)
+    {
+        Slot& s = m_slots[m_tail];
+        const GLenum r = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? WAIT_NS : 0);
+        if(r == GL_TIMEOUT_EXPIRED)
+            break;
+        glDeleteSync(s.fence);
+        s.fence = 0;
+
+        s.mapped = s.buf->map(GL_READ_ONLY);
+        if(s.mapped)
+        {
+            s.st = Slot::WRITING;
+            m_queue.push_back(m_tail);
+            m_cond.notify_one();
+        }
+        else
+        {
+            std::cout << "ERROR @Exporter: could not map staging buffer" << std::endl;
+            ++m_dropped;
+            s.st = Slot::FREE;
+        }
+        m_tail = (m_tail+1) % m_slots.size();
+    }
+}
+
+void
+Exporter::writer()
+{
+    //a reader going away must not kill the simulation. only this thread writes
+    //to the sink, so the signal is blocked here instead of ignored process wide
+    sigset_t pipe;
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+
+    //measure the baseline for report() now rather than on the gl thread
+    host::stream_copy_mbps();
+
+    for(;;)
+    {
+        unsigned int i = 0;
+        const cl_float4* pos = NULL;
+        unsigned long long step = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while(!m_quit && m_queue.empty())
+                m_cond.wait(lock);
+            if(m_queue.empty())
+                break;
+            i = m_queue.front();
+            m_queue.pop_front();
+            pos = m_slots[i].mapped;
+            step = m_slots[i].step;
+        }
+
+        std::size_t out = 0;
+        const char* payload = NULL;
+        const cl_uint nbytes = open_sink() ? encode(pos, &payload) : 0;
+        if(nbytes &&
+           write_all(&step, sizeof(step)) &&
+           write_all(&nbytes, sizeof(nbytes)) &&
+           write_all(payload, nbytes))
+        {
+            commit();
+            out = sizeof(step) + sizeof(nbytes) + nbytes;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots[i].st = Slot::DONE;
+        if(out)
+        {
+            m_raw_bytes += m_frame.size()*sizeof(cl_uint);
+            m_out_bytes += out;
+            //whole float4s are read, xyz written, and read again from m_prev with DELTA
+            m_repack_bytes += m_nelem*sizeof(cl_float4) + m_frame.size()*sizeof(cl_uint)*(m_flags & DELTA ? 2 : 1);
+            m_repack_ms += m_encode_ms;
+            ++m_frames;
+        }
+        else
+            ++m_dropped;
+    }
+
+    if(m_fd >= 0)
+        close(m_fd);
+}
+
+bool
+Exporter::open_sink()
+{
+    if(m_ready)
+        return true;
+    if(m_fd == SINK_FAILED)
+        return false;
+
+    //a blocking open of a fifo waits for a reader and would hang the destructor
+    //if none ever shows up, so poll without blocking until one does or we quit
+    while(m_fd < 0)
+    {
+        m_fd = open(m_path.c_str(), O_WRONLY | O_NONBLOCK | O_CREAT | O_TRUNC, 0644);
+        if(m_fd >= 0 || (errno != ENXIO && errno != EINTR))
+            break;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if(m_cond.wait_for(lock, OPEN_RETRY, [this] { return m_quit; }))
+        {
+            m_fd = SINK_FAILED;
+            return false;
+        }
+    }
+    if(m_fd >= 0)
+    {
+        //writes should block once there is a reader, write_all assumes so
+        const int fl = fcntl(m_fd, F_GETFL);
+        if(fl >= 0)
+            fcntl(m_fd, F_SETFL, fl & ~O_NONBLOCK);
+    }
+    if(m_fd < 0)
+    {
+        std::cout << "ERROR @Exporter: " << m_path << ": " << std::strerror(errno) << std::endl;
+        m_fd = SINK_FAILED;
+        return false;
+    }
+
+    const cl_uint header[] = { VERSION, m_flags, (cl_uint)m_nelem };
+    m_ready = write_all("CLLP", 4) && write_all(header, sizeof(header));
+    return m_ready;
+}
+
+bool
+Exporter::write_all(const void* data, std::size_t bytes)
+{
+    const char* p = static_cast<const char*>(data);
+    while(bytes)
+    {
+        const ssize_t w = write(m_fd, p, bytes);
+        if(w < 0 && errno == EINTR)
+            continue;
+        if(w <= 0)
+        {
+            std::cout << "ERROR @Exporter: " << m_path << ": " << std::strerror(errno) << std::endl;
+            close(m_fd);
+            m_fd = SINK_FAILED;
+            m_ready = false;
+            return false;
+        }
+        p += w;
+        bytes -= w;
+    }
+    return true;
+}
+
+std::size_t
+Exporter::encode(const cl_float4* pos, const char** payload)
+{
+    const std::size_t n = 3*m_nelem;
+    m_frame.resize(n);
+    if(m_flags & DELTA)
+        m_prev.resize(n, 0);
+
+    //xyz only, w is always 1. xor on the raw bits keeps the delta lossless.
+    //the mapped staging buffer is walked in tiles by the pinned host threads
+    cl_uint* const frame = m_frame.data();
+    const cl_uint* const prev = m_flags & DELTA ? m_prev.data() : NULL;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    host::for_each_tile(m_nelem, host::tile_elems(sizeof(cl_float4) + 6*sizeof(cl_uint)),
+                        [=](std::size_t b, std::size_t e) {
+        for(std::size_t i=b; i<e; ++i)
+        {
+            host::prefetch(pos+i);
+            cl_uint xyz[3];
+            std::memcpy(xyz, pos[i].s, sizeof(xyz));
+            for(unsigned int k=0; k<3; ++k)
+                frame[3*i+k] = prev ? xyz[k] ^ prev[3*i+k] : xyz[k];
+        }
+    });
+    m_encode_ms = ms_t(std::chrono::steady_clock::now() - start).count();
+
+    *payload = reinterpret_cast<const char*>(m_frame.data());
+    const int raw_bytes = n*sizeof(cl_uint);
+#ifdef CLL_HAVE_LZ4
+    if(m_flags & LZ4)
+    {
+        m_packed.resize(LZ4_compressBound(raw_bytes));
+        const int c = LZ4_compress_default(*payload, m_packed.data(), raw_bytes, m_packed.size());
+        if(c <= 0)
+        {
+            std::cout << "ERROR @Exporter: lz4 compression failed" << std::endl;
+            return 0;
+        }
+        *payload = m_packed.data();
+        return c;
+    }
+#endif
+    return raw_bytes;
+}
+
+void
+Exporter::commit()
+{
+    //a dropped frame must not become the reference, the reader never saw it
+    if(!(m_flags & DELTA))
+        return;
+    const cl_uint* const frame = m_frame.data();
+    cl_uint* const prev = m_prev.data();
+    host::for_each_tile(m_frame.size(), host::tile_elems(2*sizeof(cl_uint)),
+                        [=](std::size_t b, std::size_t e) {
+        for(std::size_t j=b; j<e; ++j)
+            prev[j] ^= frame[j];
+    });
+}
+
+void
+Exporter::report(std::ostream& os)
+{
+    if(!m_enabled)
+        return;
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double elapsed = ms_t(now - m_last_report).count();
+    if(elapsed < 1000.)
+        return;
+
+    os << "export: " << m_frames << " frames, " << m_dropped << " dropped, "
+       << m_out_bytes/(elapsed*1000.) << "MB/s written ("
+       << m_raw_bytes/(elapsed*1000.) << "MB/s raw)" << std::endl;
+    if(m_repack_ms > 0.)
+        host::report_bandwidth(os, "export repack", m_repack_bytes, m_repack_ms);
+
+    m_last_report = now;
+    m_raw_bytes = 0;
+    m_out_bytes = 0;
+    m_repack_bytes = 0;
+    m_repack_ms = 0.;
+    m_frames = 0;
+    m_dropped = 0;
+}
+
+}
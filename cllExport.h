@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#ifndef CLLEXPORT_H
+#define CLLEXPORT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tr1/memory>
+
+#include <GL/glew.h>
+#include <CL/cl.h>
+
+#include <boost/utility.hpp>
+
+#include "cllUtil.h"
+#include "cllVBO.h"
+
+namespace cll {
+
+// streams particle positions to a file, fifo or stdout ("-") every n frames.
+// with "-" the exporter takes over stdout when constructed and points fd 1 at
+// stderr until it is destroyed, so anything printed meanwhile can't end up in
+// the stream. create it before any other output.
+// the gl thread only queues a gpu side copy into a ring of staging buffers;
+// they are mapped once their fence has passed and a writer thread encodes
+// straight from the mapping, so the simulation never waits on the sink.
+//
+// format, native byte order:
+//   header: "CLLP" u32 version u32 flags u32 nelem
+//   frame:  u64 frame u32 nbytes, then nbytes of payload
+// frame counts step() calls from 0, one per rendered frame. it is not the
+// simulation step of the energy output, which counts SUBSTEPS per frame.
+// the payload is nelem xyz float triples, several particle systems follow
+// each other. with DELTA every u32 is xor'ed with
+// the previous frame (zero before the first), with LZ4 the result is
+// compressed as one lz4 block of 12*nelem bytes.
+class Exporter : boost::noncopyable
+{
+public:
+    enum flags {
+        RAW = 0,
+        DELTA = 1,
+        LZ4 = 2 //only if built with lz4, dropped otherwise
+    };
+
+    static const unsigned int VERSION = 1;
+
+    // without ARB_copy_buffer and ARB_sync it logs an error and does nothing
+    Exporter(const std::string& path, GLsizei nelem, unsigned int every,
+             unsigned int flags = RAW, unsigned int ring = 3);
+
+    // the gl context must still be current, pending frames are written out
+    ~Exporter();
+
+    // call once per rendered frame from the gl thread, after cl released the
+    // vbos. each holds nelem/vbos.size() particles, they are written back to back
+    void step(const std::vector<GLuint>& vbos);
+
+    void report(std::ostream& os);
+
+private:
+    typedef VBO<cl_float4, GL_COPY_WRITE_BUFFER, GL_STREAM_READ> staging_t;
+
+    struct Slot {
+        enum state { FREE, COPYING, WRITING, DONE };
+
+        std::tr1::shared_ptr<staging_t> buf;
+        GLsync fence;
+        const cl_float4* mapped;
+        unsigned long long step;
+        state st;
+    };
+
+    void collect(bool wait);
+    void writer();
+    bool open_sink();
+    bool write_all(const void* data, std::size_t bytes);
+    // returns the payload size, 0 on failure. leaves m_prev alone, the caller
+    // commits the frame with commit() once it has been written
+    std::size_t encode(const cl_float4* pos, const char** payload);
+    void commit();
+
+    const std::string m_path;
+    const GLsizei m_nelem;
+    const unsigned int m_every;
+    unsigned int m_flags;
+    const bool m_enabled; //false if the context can't copy buffers or fence
+
+    std::vector<Slot> m_slots;
+    unsigned int m_head; //next slot to copy into
+    unsigned int m_tail; //oldest slot still copying
+    unsigned long long m_step;
+
+    //writer side, only touched by the writer thread
+    int m_fd;
+    bool m_ready; //header written
+    int m_stdout; //the original fd 1 while it is redirected, -1 otherwise
+    std::vector<cl_uint> m_prev;
+    std::vector<cl_uint> m_frame;
+    std::vector<char> m_packed; //lz4 output
+    double m_encode_ms; //repack time of the last encode
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<unsigned int> m_queue;
+    bool m_quit;
+
+    //stats, guarded by m_mutex
+    unsigned long long m_raw_bytes;
+    unsigned long long m_out_bytes;
+    unsigned long long m_repack_bytes; //host memory traffic of the repack
+    double m_repack_ms;
+    unsigned int m_frames;
+    unsigned int m_dropped;
+    std::chrono::steady_clock::time_point m_last_report;
+
+    std::thread m_thread;
+};
+
+}
+
+#endif
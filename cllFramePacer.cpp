@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "cllFramePacer.h"
+
+#include <algorithm>
+
+namespace cll {
+
+static const double SMOOTHING = 0.25; //weight of the newest sample in the moving averages
+static const unsigned int ADAPT_EVERY = 8; //frames between budget changes, lets the averages settle
+static const double HEADROOM = 0.85; //fraction of the period we allow compute+draw to take
+static const double GROW_BELOW = 0.6; //grow the budget only when well under target
+static const double MAX_SHRINK = 0.5;
+static const double GROW = 1.1;
+
+static inline double smooth(double avg, double sample)
+{
+    return avg + SMOOTHING*(sample - avg);
+}
+
+FramePacer::FramePacer(unsigned int fps, std::size_t max_elems, std::size_t min_elems)
+    : m_period(std::chrono::duration_cast<clock_type::duration>(std::chrono::nanoseconds(1000000000/fps))),
+      m_max(max_elems),
+      m_min(std::min(min_elems, max_elems)),
+      m_budget(max_elems),
+      m_adaptive(false),
+      m_deadline(clock_type::now()),
+      m_begin(m_deadline),
+      m_computed(m_deadline),
+      m_last_report(m_deadline),
+      m_compute_ms(0.),
+      m_draw_ms(0.),
+      m_frames(0),
+      m_late(0)
+{
+}
+
+void
+FramePacer::begin_frame()
+{
+    m_begin = clock_type::now();
+}
+
+void
+FramePacer::end_compute()
+{
+    m_computed = clock_type::now();
+    m_compute_ms = smooth(m_compute_ms, ms_t(m_computed - m_begin).count());
+}
+
+void
+FramePacer::end_draw()
+{
+    m_draw_ms = smooth(m_draw_ms, ms_t(clock_type::now() - m_computed).count());
+    ++m_frames;
+    if(m_adaptive && m_frames % ADAPT_EVERY == 0)
+        adapt();
+}
+
+unsigned int
+FramePacer::next_delay()
+{
+    //advance from the last deadline, not from now, so rounding errors cancel out
+    m_deadline += m_period;
+    const clock_type::time_point now = clock_type::now();
+    if(now >= m_deadline)
+    {
+        ++m_late;
+        //more than a whole frame behind: resync instead of bursting to catch up
+        if(now - m_deadline > m_period)
+            m_deadline = now;
+        return 0;
+    }
+    return (unsigned int)(ms_t(m_deadline - now).count() + 0.5);
+}
+
+void
+FramePacer::set_adaptive(bool a)
+{
+    m_adaptive = a;
+    if(!m_adaptive)
+        m_budget = m_max;
+}
+
+void
+FramePacer::adapt()
+{
+    const double target = ms_t(m_period).count() * HEADROOM;
+    const double work = m_compute_ms + m_draw_ms;
+    if(work <= 0.)
+        return;
+
+    double budget = (double)m_budget;
+    if(work > target)
+        budget *= std::max(target/work, MAX_SHRINK); //cost is roughly linear in particle count
+    else if(work < target*GROW_BELOW)
+        budget = budget*GROW + 1.;
+    else
+        return;
+
+    m_budget = std::max(m_min, std::min(m_max, (std::size_t)budget));
+}
+
+bool
+FramePacer::report(std::ostream& os, std::size_t steps)
+{
+    const clock_type::time_point now = clock_type::now();
+    const double elapsed = ms_t(now - m_last_report).count();
+    if(elapsed < 1000.)
+        return false;
+
+    const double fps = m_frames*1000./elapsed;
+    os << "fps: " << fps
+       << " compute: " << m_compute_ms << "ms"
+       << " draw: " << m_draw_ms << "ms"
+       << " late: " << m_late
+       << " particles: " << m_budget << "/" << m_max
+       << (m_adaptive ? " (adaptive)" : "")
+       << " particle steps/s: " << fps*m_budget*steps << std::endl;
+
+    m_last_report = now;
+    m_frames = 0;
+    m_late = 0;
+    return true;
+}
+
+}
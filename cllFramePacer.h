@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#ifndef CLLFRAMEPACER_H
+#define CLLFRAMEPACER_H
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+#include <boost/utility.hpp>
+
+#include "cllUtil.h"
+
+namespace cll {
+
+// wall clock frame scheduler. deadlines advance by a fixed period so the
+// millisecond truncation of glutTimerFunc does not accumulate, and in
+// adaptive mode the particle budget is scaled to hold the target frame time.
+class FramePacer : boost::noncopyable
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    FramePacer(unsigned int fps, std::size_t max_elems, std::size_t min_elems);
+
+    void begin_frame();
+    void end_compute();
+    void end_draw();
+
+    // ms until the next frame is due, to be passed to glutTimerFunc
+    unsigned int next_delay();
+
+    std::size_t budget() const { return m_budget; }
+
+    bool adaptive() const { return m_adaptive; }
+    void set_adaptive(bool a);
+
+    // steps: budget sized integration steps per frame, systems times substeps,
+    // for the throughput figure. prints at most once per second, returns whether it did
+    bool report(std::ostream& os, std::size_t steps = 1);
+
+private:
+    void adapt();
+
+    const clock_type::duration m_period;
+    const std::size_t m_max;
+    const std::size_t m_min;
+    std::size_t m_budget;
+    bool m_adaptive;
+
+    clock_type::time_point m_deadline;
+    clock_type::time_point m_begin;
+    clock_type::time_point m_computed;
+    clock_type::time_point m_last_report;
+
+    //exponential moving averages in ms
+    double m_compute_ms;
+    double m_draw_ms;
+
+    unsigned int m_frames;
+    unsigned int m_late;
+};
+
+}
+
+#endif
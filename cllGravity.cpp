@@ -30,9 +30,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <CL/cl.hpp>
 
 #include "cllError.h"
+#include "cllUtil.h"
+
+#include <cmath>
 
 #define USE_HOST_PTR 1
-#define TOSTRING(A) #A
 
 namespace cll {
 
@@ -40,37 +42,177 @@ enum ARGS {
     POS,
     VEL,
     COLOR,
-    MOUSE
+    MOUSE,
+    DT,
+    DAMP
+};
+
+enum ENERGY_ARGS {
+    E_POS,
+    E_VEL,
+    E_MOUSE,
+    E_NUM,
+    E_SCRATCH,
+    E_PARTIAL
 };
 
+static const unsigned int ENERGY_LOCAL = 64; //work group size of the reduction, power of two
+static const unsigned int ENERGY_GROUPS = 64; //partial sums read back to the host
+static const float FRICTION = 0.99f; //velocity kept per unit of time
+static const cl_uint DRAW_CMD[] = { 0, 1, 0, 0, 0 }; //count, instances, first index, base vertex, base instance
+
 const std::string Gravity::name("cl_gravity");
+const std::string Gravity::leapfrog_name("cl_gravity_leapfrog");
+const std::string Gravity::rk4_name("cl_gravity_rk4");
+const std::string Gravity::energy_name("cl_energy");
 const std::string Gravity::opts("-cl-nv-verbose -cl-nv-opt-level=3 -cl-unsafe-math-optimizations -cl-fast-relaxed-math");
-const std::string Gravity::source = TOSTRING(
+const std::string Gravity::source = std::string(Seed::source) + Cull::source + TOSTRING(
+__constant float STRENGTH = 0.000918f;
+__constant float L_MAX = 0.9f; //prevent particles from escaping ;)
+
+float4 cl_accel(float4 p, float4 mouse)
+{
+    float4 d = mouse - p;
+    d.w = 0.f;
+    float l = fast_length(d)/2.f; //2.f is the maximal distance possible [-1,-1][1,1]
+    l = l>L_MAX ? L_MAX : l;
+    return fast_normalize(d) * STRENGTH * (1.f-l*l);
+}
+
+//integral of cl_accel over the distance, so that accel = -grad(potential)
+float cl_potential(float4 p, float4 mouse)
+{
+    float4 d = mouse - p;
+    d.w = 0.f;
+    float r = length(d);
+    float rc = r < 2.f*L_MAX ? r : 2.f*L_MAX;
+    return STRENGTH*(rc - rc*rc*rc/12.f) + STRENGTH*(1.f-L_MAX*L_MAX)*(r - rc);
+}
+
+void cl_store(__global float4* pos,
+              __global float4* vel,
+              __global float4* color,
+              unsigned int i,
+              float4 p,
+              float4 v)
+{
+    float4 c = color[i];
+    c.x = (2.f+p.z)*0.5f;
+
+    pos[i] = p;
+    vel[i] = v;
+    color[i] = c;
+}
+) + TOSTRING(
+//one kernel per integrator, so euler doesn't pay for the registers of rk4.
+//they all take the same arguments
+
+//explicit euler
 __kernel void cl_gravity(__global float4* pos,
                       __global float4* vel,
                       __global float4* color,
-                      float4 mouse)
+                      float4 mouse,
+                      float dt,
+                      float damp)
 {
     //get our index in the array
     unsigned int i = get_global_id(0);
     float4 p = pos[i];
     float4 v = vel[i];
-    float4 c = color[i];
 
-    float4 d = mouse - p;
-    float l = fast_length(d)/2.f; //2.f is the maximal distance possible [-1,-1][1,1]
-    l = l>0.9f ? 0.9f : l; //prevent particles from escaping ;)
-    float4 dn = fast_normalize(d);
-    v*=0.99f; //friction
-    v += dn * 0.000918f * (1.f-l*l);
-    p = (mouse - d)+v;
+    v*=damp; //friction
+    v += cl_accel(p, mouse)*dt;
+    p += v*dt;
     p.w = 1.f;
 
-    c.x = (2.f+p.z)*0.5f;
+    cl_store(pos, vel, color, i, p, v);
+}
 
-    pos[i] = p;
-    vel[i] = v;
-    color[i] = c;
+//kick drift kick with the friction split in halves
+__kernel void cl_gravity_leapfrog(__global float4* pos,
+                                  __global float4* vel,
+                                  __global float4* color,
+                                  float4 mouse,
+                                  float dt,
+                                  float damp)
+{
+    unsigned int i = get_global_id(0);
+    float4 p = pos[i];
+    float4 v = vel[i];
+    float vw = v.w;
+
+    float h = sqrt(damp);
+    v.w = 0.f;
+    v = v*h + cl_accel(p, mouse)*(0.5f*dt);
+    p += v*dt;
+    p.w = 1.f;
+    v = v*h + cl_accel(p, mouse)*(0.5f*dt);
+    v.w = vw;
+
+    cl_store(pos, vel, color, i, p, v);
+}
+
+//friction as linear drag
+__kernel void cl_gravity_rk4(__global float4* pos,
+                             __global float4* vel,
+                             __global float4* color,
+                             float4 mouse,
+                             float dt,
+                             float damp)
+{
+    unsigned int i = get_global_id(0);
+    float4 p = pos[i];
+    float4 v = vel[i];
+    float vw = v.w;
+
+    float k = -log(damp)/dt;
+    float hdt = 0.5f*dt;
+    v.w = 0.f;
+    float4 k1p = v;
+    float4 k1v = cl_accel(p, mouse) - k*v;
+    float4 k2p = v + k1v*hdt;
+    float4 k2v = cl_accel(p + k1p*hdt, mouse) - k*k2p;
+    float4 k3p = v + k2v*hdt;
+    float4 k3v = cl_accel(p + k2p*hdt, mouse) - k*k3p;
+    float4 k4p = v + k3v*dt;
+    float4 k4v = cl_accel(p + k3p*dt, mouse) - k*k4p;
+    p += (k1p + 2.f*k2p + 2.f*k3p + k4p)*(dt/6.f);
+    v += (k1v + 2.f*k2v + 2.f*k3v + k4v)*(dt/6.f);
+    p.w = 1.f;
+    v.w = vw;
+
+    cl_store(pos, vel, color, i, p, v);
+}
+
+//per group sums of kinetic (x) and potential (y) energy, unit masses
+__kernel void cl_energy(__global const float4* pos,
+                        __global const float4* vel,
+                        float4 mouse,
+                        unsigned int n,
+                        __local float2* scratch,
+                        __global float2* partial)
+{
+    unsigned int lid = get_local_id(0);
+    float2 e = (float2)(0.f, 0.f);
+    for(unsigned int i = get_global_id(0); i < n; i += get_global_size(0))
+    {
+        float4 v = vel[i];
+        v.w = 0.f;
+        e.x += 0.5f*dot(v, v);
+        e.y += cl_potential(pos[i], mouse);
+    }
+    scratch[lid] = e;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(unsigned int s = get_local_size(0)/2; s > 0; s >>= 1)
+    {
+        if(lid < s)
+            scratch[lid] += scratch[lid+s];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(lid == 0)
+        partial[get_group_id(0)] = scratch[0];
 }
 );
 
@@ -82,28 +224,77 @@ struct Gravity::data_t::Events
     cl::Event ACQ_GL;
     cl::Event REL_GL;
     cl::Event EXEC;
+    cl::Event ENERGY;
+    cl::Event CULL;
+};
+
+//the euler kernel is the bundle's, these are per data_t like the reduction
+struct Gravity::data_t::Integrators
+{
+    cl::Kernel leapfrog;
+    cl::Kernel rk4;
+};
+
+struct Gravity::data_t::Reduction
+{
+    cl::Kernel kernel;
+    cl::Buffer partial;
+    std::vector<cl_float2> partial_host;
 };
 
-Gravity::data_t::data_t(const std::vector<cl_float4>& pos,
-       const std::tr1::function< std::vector<cl_float4>& () >& v_host_injector,
-       const std::vector<cl_float4>& col)
-    : p_vbo(new cll::VBO<cl_float4>(pos)),
-      c_vbo(new cll::VBO<cl_float4>(col)),
+Gravity::data_t::data_t(GLsizei n,
+       const std::tr1::function< HostArray<cl_float4>& () >& v_host_injector,
+       const Seed& s)
+    : p_vbo(new cll::VBO<cl_float4>(n)),
+      c_vbo(new cll::VBO<cl_float4>(n)),
+      i_vbo(new cll::VBO<cl_uint, GL_ELEMENT_ARRAY_BUFFER>(n)),
+      d_vbo(GLEW_ARB_draw_indirect ? new cll::VBO<cl_uint, GL_DRAW_INDIRECT_BUFFER>(DRAW_CMD, 5) : NULL),
       v_host(v_host_injector()),
       m_pos({{0.f, 0.f, -1.f, 1.f}}),
-      events(new Events())
+      n_active(n),
+      seed(s),
+      seed_ms(0.),
+      integrator(EULER),
+      dt(1.f),
+      substeps(1),
+      energy_every(0),
+      energy({0., 0., 0}),
+      steps(0),
+      n_drawn(n),
+      events(new Events()),
+      integrators(new Integrators()),
+      reduction(new Reduction())
 {
+    //device seeding has to wait for the cl context, see cl_load
+    if(seed.on != Seed::HOST)
+        return;
+
+    //fill the vbos in place, no staging copy on the host
+    cl_float4* pos = p_vbo->map(GL_WRITE_ONLY);
+    cl_float4* col = c_vbo->map(GL_WRITE_ONLY);
+    if(pos && col)
+        seed_ms = seed.fill_host(pos, v_host.data(), col, n);
+    else
+        std::cout << "ERROR @data_t: could not map vbos for seeding" << std::endl;
+    if(pos)
+        p_vbo->unmap();
+    if(col)
+        c_vbo->unmap();
 }
 
 void
 Gravity::cl_load(ExecutorBundle& bundle, data_t& data)
 {
-    glFinish();
+    if(bundle.owns_gl)
+        glFinish();
     bundle.queue.finish();
 
     try{
         data.cl_buffers.push_back(cl::BufferGL(bundle.context, CL_MEM_READ_WRITE, data.p_vbo->id(), NULL));
         data.cl_buffers.push_back(cl::BufferGL(bundle.context, CL_MEM_READ_WRITE, data.c_vbo->id(), NULL));
+        data.cl_buffers.push_back(cl::BufferGL(bundle.context, CL_MEM_WRITE_ONLY, data.i_vbo->id(), NULL));
+        if(data.d_vbo)
+            data.cl_buffers.push_back(cl::BufferGL(bundle.context, CL_MEM_WRITE_ONLY, data.d_vbo->id(), NULL));
 
         size_t bytes = data.v_host.size()*sizeof(data.v_host[0]);
 
@@ -118,9 +309,17 @@ Gravity::cl_load(ExecutorBundle& bundle, data_t& data)
                                         &data.events->LOAD_V);
 #endif
 
-        bundle.kernel.setArg(POS, data.cl_buffers[0]); //position vbo
-        bundle.kernel.setArg(VEL, data.v_cl); //position vbo
-        bundle.kernel.setArg(COLOR, data.cl_buffers[1]); //color vbo
+        //kernels are per program, so these work on the queue of any fork
+        data.integrators->leapfrog = cl::Kernel(bundle.program, leapfrog_name.c_str(), NULL);
+        data.integrators->rk4 = cl::Kernel(bundle.program, rk4_name.c_str(), NULL);
+        data.reduction->kernel = cl::Kernel(bundle.program, energy_name.c_str(), NULL);
+        data.reduction->partial = cl::Buffer(bundle.context, CL_MEM_WRITE_ONLY, ENERGY_GROUPS*sizeof(cl_float2), NULL, NULL);
+        data.reduction->partial_host.resize(ENERGY_GROUPS);
+
+        data.cull.load(bundle, data.i_vbo->nelem());
+
+        if(data.seed.on == Seed::DEVICE)
+            data.seed_ms = data.seed.fill_device(bundle, data.cl_buffers, data.v_cl, data.p_vbo->nelem());
     }
     catch (cl::Error er) {
         std::cout << "ERROR @cl_load: " << er.what() << " " << cll::ErrorString(er.err()) << std::endl;
@@ -130,10 +329,21 @@ Gravity::cl_load(ExecutorBundle& bundle, data_t& data)
 void
 Gravity::cl_exec(ExecutorBundle& bundle, data_t& data)
 {
-    glFinish();
+    if(bundle.owns_gl)
+        glFinish();
 
     try{
-        bundle.kernel.setArg(MOUSE, data.m_pos); //dt
+        cl::Kernel& kernel = data.integrator == LEAPFROG ? data.integrators->leapfrog
+                           : data.integrator == RK4 ? data.integrators->rk4
+                           : bundle.kernel;
+
+        //the kernel may be shared by several data_t, so all args are set every time
+        kernel.setArg(POS, data.cl_buffers[0]); //position vbo
+        kernel.setArg(VEL, data.v_cl); //velocity buffer
+        kernel.setArg(COLOR, data.cl_buffers[1]); //color vbo
+        kernel.setArg(MOUSE, data.m_pos); //gravity center
+        kernel.setArg(DT, data.dt);
+        kernel.setArg(DAMP, (cl_float)std::pow(FRICTION, data.dt));
 
         bundle.queue.enqueueAcquireGLObjects(&data.cl_buffers, NULL, &data.events->ACQ_GL);
         bundle.queue.finish();
@@ -143,16 +353,70 @@ Gravity::cl_exec(ExecutorBundle& bundle, data_t& data)
         kevents.push_back(data.events->LOAD_V);
 #endif
         kevents.push_back(data.events->ACQ_GL);
-        bundle.queue.enqueueNDRangeKernel(bundle.kernel,
-                                          cl::NullRange,
-                                          cl::NDRange(data.c_vbo->nelem()),
-                                          cl::NullRange,
-                                          &kevents,
-                                          &data.events->EXEC);
+        //in order queue, so the substeps follow each other without extra events
+        for(unsigned int s=0; s<data.substeps; ++s)
+            bundle.queue.enqueueNDRangeKernel(kernel,
+                                              cl::NullRange,
+                                              cl::NDRange(data.n_active),
+                                              cl::NullRange,
+                                              &kevents,
+                                              &data.events->EXEC);
         std::vector<cl::Event> revents;
         revents.push_back(data.events->EXEC);
 
+        const unsigned long long before = data.steps;
+        data.steps += data.substeps;
+        const bool energy = data.energy_every && before/data.energy_every != data.steps/data.energy_every;
+        if(energy)
+        {
+            data_t::Reduction& r = *data.reduction;
+            r.kernel.setArg(E_POS, data.cl_buffers[0]);
+            r.kernel.setArg(E_VEL, data.v_cl);
+            r.kernel.setArg(E_MOUSE, data.m_pos);
+            r.kernel.setArg(E_NUM, (cl_uint)data.n_active);
+            r.kernel.setArg(E_SCRATCH, cl::__local(ENERGY_LOCAL*sizeof(cl_float2)));
+            r.kernel.setArg(E_PARTIAL, r.partial);
+            bundle.queue.enqueueNDRangeKernel(r.kernel,
+                                              cl::NullRange,
+                                              cl::NDRange(ENERGY_GROUPS*ENERGY_LOCAL),
+                                              cl::NDRange(ENERGY_LOCAL),
+                                              &revents,
+                                              &data.events->ENERGY);
+            revents.push_back(data.events->ENERGY);
+        }
+
+        if(data.cull.enabled)
+        {
+            data.cull.exec(bundle, data.cl_buffers[0], data.cl_buffers[2],
+                           data.d_vbo ? &data.cl_buffers[3] : NULL,
+                           data.n_active, &revents, &data.events->CULL);
+            revents.push_back(data.events->CULL);
+        }
+
         bundle.queue.enqueueReleaseGLObjects(&data.cl_buffers, &revents, &data.events->REL_GL);
+        if(energy)
+        {
+            //only the per group sums come back, never the particles
+            data_t::Reduction& r = *data.reduction;
+            bundle.queue.enqueueReadBuffer(r.partial, CL_TRUE, 0,
+                                           ENERGY_GROUPS*sizeof(cl_float2),
+                                           r.partial_host.data());
+            double kinetic = 0.;
+            double potential = 0.;
+            for(unsigned int g=0; g<ENERGY_GROUPS; ++g)
+            {
+                kinetic += r.partial_host[g].s[0];
+                potential += r.partial_host[g].s[1];
+            }
+            data.energy.kinetic = kinetic;
+            data.energy.potential = potential;
+            data.energy.step = data.steps;
+        }
+        //with a draw command the count stays on the device, no readback
+        if(!data.cull.enabled)
+            data.n_drawn = data.n_active;
+        else if(!data.d_vbo)
+            data.n_drawn = data.cull.count(bundle);
         bundle.queue.flush();
         data.events->REL_GL.wait();
     }
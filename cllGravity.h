@@ -33,24 +33,58 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include "cllExecutor.h"
 #include "cllVBO.h"
+#include "cllHost.h"
+#include "cllSeed.h"
+#include "cllCull.h"
 
 namespace cll {
 
 struct Gravity {
     static const std::string source;
-    static const std::string name;
+    static const std::string name; //euler
+    static const std::string leapfrog_name;
+    static const std::string rk4_name;
+    static const std::string energy_name;
     static const std::string opts;
 
+    enum integrator_t {
+        EULER = 0, //the original, needs dt around 1
+        LEAPFROG = 1, //velocity verlet, symplectic without friction
+        RK4 = 2
+    };
+
+    struct energy_t {
+        double kinetic;
+        double potential;
+        unsigned long long step; //simulation step the sums were taken at
+    };
+
     struct data_t {
         struct inject_point {};
 
-        data_t(const std::vector<cl_float4>& pos,
-               const std::tr1::function< std::vector<cl_float4>& () >& v_host_injector,
-               const std::vector<cl_float4>& col);
+        // v_host must hold at least n particles, it is filled by the seed
+        data_t(GLsizei n,
+               const std::tr1::function< HostArray<cl_float4>& () >& v_host_injector,
+               const Seed& seed);
         const std::tr1::shared_ptr< cll::VBO<cl_float4> > p_vbo;
         const std::tr1::shared_ptr< cll::VBO<cl_float4> > c_vbo;
-        const std::vector<cl_float4>& v_host;
+        const std::tr1::shared_ptr< cll::VBO<cl_uint, GL_ELEMENT_ARRAY_BUFFER> > i_vbo; //visible particles
+        // indirect draw command for i_vbo, the cull writes its count.
+        // NULL without ARB_draw_indirect, then the count is read back
+        const std::tr1::shared_ptr< cll::VBO<cl_uint, GL_DRAW_INDIRECT_BUFFER> > d_vbo;
+        HostArray<cl_float4>& v_host;
         cl_float4 m_pos;
+        GLsizei n_active; //particles simulated and drawn, <= p_vbo->nelem()
+        const Seed seed;
+        double seed_ms; //time spent filling in the particles, host or device
+        integrator_t integrator;
+        cl_float dt; //time per substep, one frame used to be dt 1
+        unsigned int substeps; //kernel launches per exec
+        unsigned int energy_every; //steps between energy reductions, 0 disables them
+        energy_t energy; //updated by cl_exec
+        unsigned long long steps;
+        Cull cull;
+        GLsizei n_drawn; //indices in i_vbo if culling without d_vbo, else n_active
         std::vector<cl::Memory> cl_buffers;
         cl::Buffer v_cl;
 
@@ -58,6 +92,10 @@ struct Gravity {
         friend struct Gravity;
         struct Events;
         const std::tr1::shared_ptr< Events > events;
+        struct Integrators;
+        const std::tr1::shared_ptr< Integrators > integrators;
+        struct Reduction;
+        const std::tr1::shared_ptr< Reduction > reduction;
     };
 
     static void cl_load(ExecutorBundle&, data_t& data);
@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "cllHost.h"
+#include "cllUtil.h"
+
+#include <chrono>
+#include <unistd.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cll {
+namespace host {
+
+static const std::size_t FALLBACK_L2 = 256*1024;
+static const std::size_t FALLBACK_PAGE = 4096;
+static const std::size_t STREAM_ELEMS = 4*1024*1024; //64MB per array, well past any L3
+static const unsigned int STREAM_REPS = 3;
+
+unsigned int num_threads()
+{
+    static const unsigned int n = std::max(1u, std::thread::hardware_concurrency());
+    return n;
+}
+
+std::size_t l2_bytes()
+{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    static const long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if(l2 > 0)
+        return (std::size_t)l2;
+#endif
+    return FALLBACK_L2;
+}
+
+std::size_t page_bytes()
+{
+    static const long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (std::size_t)page : FALLBACK_PAGE;
+}
+
+std::size_t tile_elems(std::size_t bytes_per_elem)
+{
+    const std::size_t n = l2_bytes()/2/std::max<std::size_t>(1, bytes_per_elem);
+    return std::max<std::size_t>(CACHE_LINE, n);
+}
+
+void pin(unsigned int n)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(n % num_threads(), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)n;
+#endif
+}
+
+static double measure_stream_copy()
+{
+    HostArray<cl_float4> in(STREAM_ELEMS);
+    HostArray<cl_float4> out(STREAM_ELEMS);
+    const cl_float4* src = in.data();
+    cl_float4* dst = out.data();
+    const std::size_t tile = tile_elems(2*sizeof(cl_float4));
+
+    double best = 0.;
+    for(unsigned int r=0; r<STREAM_REPS; ++r)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for_each_tile(STREAM_ELEMS, tile, [=](std::size_t b, std::size_t e) {
+            for(std::size_t i=b; i<e; ++i)
+            {
+                prefetch(src+i);
+                stream(dst+i, src[i]);
+            }
+            stream_fence();
+        });
+        const double ms = ms_t(std::chrono::steady_clock::now() - start).count();
+        //STREAM counts one read and one write per element
+        const double mbps = 2.*STREAM_ELEMS*sizeof(cl_float4)/(ms*1000.);
+        best = std::max(best, mbps);
+    }
+    return best;
+}
+
+double stream_copy_mbps()
+{
+    static const double mbps = measure_stream_copy();
+    return mbps;
+}
+
+void report_bandwidth(std::ostream& os, const std::string& what, std::size_t bytes, double ms)
+{
+    const double mbps = ms > 0. ? bytes/(ms*1000.) : 0.;
+    const double base = stream_copy_mbps();
+    os << what << ": " << bytes/(1024*1024) << "MB in " << ms << "ms, "
+       << mbps << "MB/s (" << (base > 0. ? 100.*mbps/base : 0.) << "% of stream copy "
+       << base << "MB/s)" << std::endl;
+}
+
+}
+}
@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#ifndef CLLHOST_H
+#define CLLHOST_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <CL/cl.h>
+
+#include <boost/utility.hpp>
+
+namespace cll {
+
+// blocked host side execution for large particle arrays. work is statically
+// partitioned over pinned threads, so a thread always gets the same range of
+// a given array and first touch places those pages on its local numa node.
+namespace host {
+
+static const std::size_t CACHE_LINE = 64;
+static const std::size_t PREFETCH_AHEAD = 8; //cache lines
+
+unsigned int num_threads();
+std::size_t l2_bytes();
+std::size_t page_bytes();
+
+// elements per tile, so that all streams of a tile fit in half of L2
+std::size_t tile_elems(std::size_t bytes_per_elem);
+
+// pin the calling thread to cpu n % num_threads()
+void pin(unsigned int n);
+
+// STREAM style copy bandwidth in MB/s, measured once and cached
+double stream_copy_mbps();
+
+void report_bandwidth(std::ostream& os, const std::string& what, std::size_t bytes, double ms);
+
+inline std::size_t chunk_begin(std::size_t n, unsigned int t, unsigned int nt)
+{
+    return n/nt*t + std::min<std::size_t>(t, n%nt);
+}
+
+// f(begin, end) is called once per thread with its static chunk of [0,n)
+template<typename F>
+void parallel_for(std::size_t n, F f)
+{
+    const unsigned int nt = (unsigned int)std::max<std::size_t>(1, std::min<std::size_t>(num_threads(), n));
+    std::vector<std::thread> threads;
+    threads.reserve(nt);
+    for(unsigned int t=0; t<nt; ++t)
+    {
+        threads.push_back(std::thread([=]() {
+            pin(t);
+            f(chunk_begin(n, t, nt), chunk_begin(n, t+1, nt));
+        }));
+    }
+    for(unsigned int t=0; t<nt; ++t)
+        threads[t].join();
+}
+
+// f(begin, end) is called for every tile, each thread walks the tiles of its own chunk
+template<typename F>
+void for_each_tile(std::size_t n, std::size_t tile, F f)
+{
+    parallel_for(n, [=](std::size_t b, std::size_t e) {
+        for(std::size_t i=b; i<e; i+=tile)
+            f(i, std::min(i+tile, e));
+    });
+}
+
+inline void prefetch(const void* p)
+{
+    __builtin_prefetch((const char*)p + PREFETCH_AHEAD*CACHE_LINE, 0, 0);
+}
+
+// non temporal store, bypasses the cache for data we won't read again soon
+inline void stream(cl_float4* dst, const cl_float4& v)
+{
+#ifdef __SSE__
+    _mm_stream_ps(dst->s, _mm_load_ps(v.s));
+#else
+    *dst = v;
+#endif
+}
+
+// make streamed stores visible before the data is handed on
+inline void stream_fence()
+{
+#ifdef __SSE__
+    _mm_sfence();
+#endif
+}
+
+}
+
+// cache line aligned host array, left uninitialized. every page is touched in
+// parallel with the same partition host::parallel_for uses, so pages end up
+// local to the threads working on them without a full write pass
+template<typename T>
+class HostArray : boost::noncopyable
+{
+public:
+    explicit HostArray(std::size_t n);
+    ~HostArray() { std::free(m_data); }
+
+    std::size_t size() const { return m_size; }
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+
+    T& operator[](std::size_t i) { return m_data[i]; }
+    const T& operator[](std::size_t i) const { return m_data[i]; }
+
+private:
+    static_assert(std::is_trivial<T>::value, "HostArray is for plain data only");
+
+    std::size_t m_size;
+    T* m_data;
+};
+
+
+template<typename T>
+HostArray<T>::HostArray(std::size_t n)
+    : m_size(n), m_data(NULL)
+{
+    void* p = NULL;
+    if(posix_memalign(&p, host::CACHE_LINE, std::max<std::size_t>(1, n)*sizeof(T)) != 0)
+        throw std::bad_alloc();
+    m_data = static_cast<T*>(p);
+
+    char* const d = reinterpret_cast<char*>(m_data);
+    const std::size_t page = host::page_bytes();
+    host::parallel_for(n, [=](std::size_t b, std::size_t e) {
+        //one write per page is enough for first touch
+        for(std::size_t i=b*sizeof(T); i<e*sizeof(T); i=(i/page+1)*page)
+            d[i] = 0;
+    });
+}
+
+}
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#ifndef CLLJOBQUEUE_H
+#define CLLJOBQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+namespace cll {
+
+// bounded lock free multi producer multi consumer queue, every cell carries a
+// sequence number telling producers and consumers whose turn it is
+// (after Dmitry Vyukov's bounded mpmc queue)
+template<typename T>
+class JobQueue : boost::noncopyable
+{
+public:
+    explicit JobQueue(std::size_t capacity); //rounded up to a power of two
+
+    bool push(const T& v); //false if full
+    bool pop(T& v); //false if empty
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> seq;
+        T data;
+    };
+
+    static const std::size_t CACHE_LINE = 64;
+
+    static std::size_t pow2_ceil(std::size_t n);
+
+    std::vector<Cell> m_cells;
+    std::size_t m_mask;
+    char m_pad0[CACHE_LINE];
+    std::atomic<std::size_t> m_enqueue;
+    char m_pad1[CACHE_LINE];
+    std::atomic<std::size_t> m_dequeue;
+    char m_pad2[CACHE_LINE];
+};
+
+
+template<typename T>
+std::size_t JobQueue<T>::pow2_ceil(std::size_t n)
+{
+    std::size_t p = 2;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+template<typename T>
+JobQueue<T>::JobQueue(std::size_t capacity)
+    : m_cells(pow2_ceil(capacity)), m_mask(m_cells.size()-1), m_enqueue(0), m_dequeue(0)
+{
+    for(std::size_t i=0; i<m_cells.size(); ++i)
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool JobQueue<T>::push(const T& v)
+{
+    std::size_t pos = m_enqueue.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        Cell& c = m_cells[pos & m_mask];
+        const std::size_t seq = c.seq.load(std::memory_order_acquire);
+        const std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+        if(diff == 0)
+        {
+            if(m_enqueue.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+            {
+                c.data = v;
+                c.seq.store(pos+1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0)
+            return false;
+        else
+            pos = m_enqueue.load(std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+bool JobQueue<T>::pop(T& v)
+{
+    std::size_t pos = m_dequeue.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        Cell& c = m_cells[pos & m_mask];
+        const std::size_t seq = c.seq.load(std::memory_order_acquire);
+        const std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos+1);
+        if(diff == 0)
+        {
+            if(m_dequeue.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+            {
+                v = c.data;
+                c.seq.store(pos+m_mask+1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0)
+            return false;
+        else
+            pos = m_dequeue.load(std::memory_order_relaxed);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "cllSeed.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#include "cllHost.h"
+#include "cllUtil.h"
+
+// compiled for the host and stringified into the cl program, so it has to be
+// the common subset of c++ and opencl c. FN is the function qualifier.
+#define CLL_SEED_COMMON(FN) \
+FN unsigned int cll_hash(unsigned int x) \
+{ \
+    x ^= x >> 16; \
+    x *= 0x7feb352du; \
+    x ^= x >> 15; \
+    x *= 0x846ca68bu; \
+    x ^= x >> 16; \
+    return x; \
+} \
+\
+/* uniform in [0,1), k selects one of four streams per particle */ \
+FN float cll_uniform(unsigned int seed, unsigned int i, unsigned int k) \
+{ \
+    return (float)(cll_hash(cll_hash(i*4u + k) ^ cll_hash(seed)) >> 8) * (1.f/16777216.f); \
+} \
+\
+FN void cll_seed_particle(unsigned int dist, unsigned int i, unsigned int n, \
+                          unsigned int seed, float v0, float* p, float* v) \
+{ \
+    const float PI2 = 6.2831853f; \
+    const float u0 = cll_uniform(seed, i, 0u); \
+    const float u1 = cll_uniform(seed, i, 1u); \
+    const float u2 = cll_uniform(seed, i, 2u); \
+    float a = PI2*u1; \
+    float rad = 0.f; \
+    float ct = 0.f; \
+    float st = 0.f; \
+\
+    if(dist == 0u) /* disk */ \
+    { \
+        a = PI2*(float)i/(float)n; \
+        rad = 0.1f + 0.85f*u0; \
+        p[0] = rad*cos(a); \
+        p[1] = rad*sin(a); \
+        p[2] = rad - 0.5f; \
+        v[0] = v0*cos(a); \
+        v[1] = v0*sin(a); \
+        v[2] = v0; \
+    } \
+    else if(dist == 1u) /* sphere, uniform in volume */ \
+    { \
+        ct = 2.f*u0 - 1.f; \
+        st = sqrt(fmax(0.f, 1.f - ct*ct)); \
+        rad = 0.5f*cbrt(u2); \
+        p[0] = rad*st*cos(a); \
+        p[1] = rad*st*sin(a); \
+        p[2] = rad*ct; \
+        v[0] = -v0*sin(a); \
+        v[1] = v0*cos(a); \
+        v[2] = 0.f; \
+    } \
+    else if(dist == 2u) /* galaxy, denser towards the core */ \
+    { \
+        rad = 0.05f + 0.85f*u0*u0; \
+        a = 0.5f*PI2*(float)(i & 1u) + 1.5f*PI2*rad + 0.6f*(u1 - 0.5f); \
+        p[0] = rad*cos(a); \
+        p[1] = rad*sin(a); \
+        p[2] = 0.1f*(u2 - 0.5f)*(1.f - rad); \
+        v[0] = -v0*sin(a); \
+        v[1] = v0*cos(a); \
+        v[2] = 0.f; \
+    } \
+    else /* cube */ \
+    { \
+        p[0] = u0 - 0.5f; \
+        p[1] = u1 - 0.5f; \
+        p[2] = u2 - 0.5f; \
+        v[0] = v0; \
+        v[1] = v0; \
+        v[2] = v0; \
+    } \
+    p[3] = 1.f; \
+    v[3] = 1.f; \
+}
+
+namespace cll {
+
+namespace {
+
+using std::sqrt;
+using std::sin;
+using std::cos;
+using std::cbrt;
+using std::fmax;
+
+CLL_SEED_COMMON(inline)
+
+enum ARGS {
+    POS,
+    VEL,
+    COLOR,
+    COLOR_VALUE,
+    DIST,
+    NUM,
+    SEED,
+    INIT_VEL
+};
+
+inline bool stream_aligned(const void* p)
+{
+    return ((std::uintptr_t)p & 15) == 0;
+}
+
+}
+
+const std::string Seed::name("cl_seed");
+const char* const Seed::source = EXPAND_TOSTRING(CLL_SEED_COMMON()) TOSTRING(
+__kernel void cl_seed(__global float4* pos,
+                      __global float4* vel,
+                      __global float4* color,
+                      float4 col,
+                      unsigned int dist,
+                      unsigned int n,
+                      unsigned int seed,
+                      float v0)
+{
+    unsigned int i = get_global_id(0);
+    float p[4];
+    float v[4];
+    cll_seed_particle(dist, i, n, seed, v0, p, v);
+    pos[i] = (float4)(p[0], p[1], p[2], p[3]);
+    vel[i] = (float4)(v[0], v[1], v[2], v[3]);
+    color[i] = col;
+}
+);
+
+Seed::Seed(distribution d, where w, unsigned int s)
+    : dist(d), on(w), seed(s), init_vel(0.f), color({{1.f, 0.f, 0.f, 1.f}})
+{
+}
+
+double
+Seed::fill_host(cl_float4* pos, cl_float4* vel, cl_float4* col, std::size_t n) const
+{
+    //mapped gl memory gives no alignment guarantee for the streaming stores
+    const bool nt = stream_aligned(pos) && stream_aligned(vel) && stream_aligned(col);
+    const unsigned int d = dist;
+    const unsigned int s = seed;
+    const cl_float v0 = init_vel;
+    const cl_float4 c = color;
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    host::for_each_tile(n, host::tile_elems(3*sizeof(cl_float4)), [=](std::size_t b, std::size_t e)
+    {
+        cl_float4 p;
+        cl_float4 v;
+        for(std::size_t i=b; i<e; ++i)
+        {
+            cll_seed_particle(d, i, n, s, v0, p.s, v.s);
+            if(nt)
+            {
+                host::stream(pos+i, p);
+                host::stream(vel+i, v);
+                host::stream(col+i, c);
+            }
+            else
+            {
+                pos[i] = p;
+                vel[i] = v;
+                col[i] = c;
+            }
+        }
+        host::stream_fence();
+    });
+    return ms_t(std::chrono::steady_clock::now() - start).count();
+}
+
+double
+Seed::fill_device(ExecutorBundle& bundle, std::vector<cl::Memory>& gl, cl::Buffer& vel, std::size_t n) const
+{
+    cl::Kernel kernel(bundle.program, name.c_str(), NULL);
+    kernel.setArg(POS, gl[0]);
+    kernel.setArg(VEL, vel);
+    kernel.setArg(COLOR, gl[1]);
+    kernel.setArg(COLOR_VALUE, color);
+    kernel.setArg(DIST, (cl_uint)dist);
+    kernel.setArg(NUM, (cl_uint)n);
+    kernel.setArg(SEED, (cl_uint)seed);
+    kernel.setArg(INIT_VEL, init_vel);
+
+    cl::Event acq, exec, rel;
+    bundle.queue.enqueueAcquireGLObjects(&gl, NULL, &acq);
+
+    acq.wait();
+
+    //wall time around the kernel alone, the queue has no profiling enabled
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bundle.queue.enqueueNDRangeKernel(kernel,
+                                      cl::NullRange,
+                                      cl::NDRange(n),
+                                      cl::NullRange,
+                                      NULL,
+                                      &exec);
+    exec.wait();
+    const double ms = ms_t(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<cl::Event> revents(1, exec);
+    bundle.queue.enqueueReleaseGLObjects(&gl, &revents, &rel);
+    bundle.queue.finish();
+    return ms;
+}
+
+}
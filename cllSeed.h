@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2011, Christian Junker
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#ifndef CLLSEED_H
+#define CLLSEED_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "cllExecutor.h"
+
+namespace cll {
+
+// initial particle distributions. positions come from a counter based rng
+// (hash of seed and particle index), so host and device agree up to float
+// precision and every particle can be generated independently.
+struct Seed {
+    enum distribution {
+        DISK = 0, //ring around the z axis
+        SPHERE = 1,
+        GALAXY = 2, //two armed spiral
+        CUBE = 3
+    };
+
+    enum where {
+        HOST, //parallel fill of mapped vbos and v_host
+        DEVICE //cl_seed kernel writing straight into the vbos
+    };
+
+    // rng and distribution code, shared by every program that seeds
+    static const char* const source;
+    static const std::string name;
+
+    explicit Seed(distribution d = DISK, where w = DEVICE, unsigned int s = 0);
+
+    // pos and col may point into mapped gl memory. returns the fill time in ms
+    double fill_host(cl_float4* pos, cl_float4* vel, cl_float4* col, std::size_t n) const;
+
+    // gl holds the acquired position and color buffers, in that order.
+    // program must have been built from a source containing Seed::source.
+    // returns the kernel time in ms, gl acquire and release not included
+    double fill_device(ExecutorBundle& bundle, std::vector<cl::Memory>& gl, cl::Buffer& vel, std::size_t n) const;
+
+    distribution dist;
+    where on;
+    unsigned int seed;
+    cl_float init_vel;
+    cl_float4 color;
+};
+
+}
+
+#endif
@@ -39,12 +39,18 @@ template<typename T, GLenum TARGET = GL_ARRAY_BUFFER, GLenum USAGE = GL_DYNAMIC_
 class VBO : boost::noncopyable
 {
 public:
+    explicit VBO(GLsizei nelem); //uninitialized storage
     explicit VBO(const std::vector<T>&);
+    VBO(const T* elems, GLsizei nelem);
     virtual ~VBO();
 
     GLsizei nelem() const { return m_nelem; }
     GLuint id() const { return m_id; }
 
+    // NULL on failure, the buffer must not be used by gl or cl until unmap()
+    T* map(GLenum access);
+    bool unmap();
+
     static GLenum target() { return TARGET; }
     static GLenum usage() { return USAGE; }
 
@@ -54,13 +60,25 @@ private:
 };
 
 
+template<typename T, GLenum TARGET, GLenum USAGE>
+VBO<T,TARGET,USAGE>::VBO(GLsizei nelem)
+    : VBO(NULL, nelem)
+{
+}
+
 template<typename T, GLenum TARGET, GLenum USAGE>
 VBO<T,TARGET,USAGE>::VBO(const std::vector<T>& elems)
-    : m_nelem(elems.size()), m_id(0)
+    : VBO(elems.data(), elems.size())
+{
+}
+
+template<typename T, GLenum TARGET, GLenum USAGE>
+VBO<T,TARGET,USAGE>::VBO(const T* elems, GLsizei nelem)
+    : m_nelem(nelem), m_id(0)
 {
     glGenBuffers(1, &m_id); // create a vbo
     glBindBuffer(TARGET, m_id); // activate vbo id to use
-    glBufferData(TARGET, sizeof(T)*m_nelem, elems.data(), USAGE);
+    glBufferData(TARGET, sizeof(T)*m_nelem, elems, USAGE);
 
     //TODO error checking
 
@@ -69,6 +87,24 @@ VBO<T,TARGET,USAGE>::VBO(const std::vector<T>& elems)
 }
 
 
+template<typename T, GLenum TARGET, GLenum USAGE>
+T* VBO<T,TARGET,USAGE>::map(GLenum access)
+{
+    glBindBuffer(TARGET, m_id);
+    T* p = static_cast<T*>(glMapBuffer(TARGET, access));
+    glBindBuffer(TARGET, 0);
+    return p;
+}
+
+template<typename T, GLenum TARGET, GLenum USAGE>
+bool VBO<T,TARGET,USAGE>::unmap()
+{
+    glBindBuffer(TARGET, m_id);
+    const GLboolean ok = glUnmapBuffer(TARGET);
+    glBindBuffer(TARGET, 0);
+    return ok == GL_TRUE;
+}
+
 
 template<typename T, GLenum TARGET, GLenum USAGE>
 VBO<T,TARGET,USAGE>::~VBO()
@@ -32,8 +32,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <assert.h>
 #include <tr1/memory>
 #include <cmath>
+#include <chrono>
 
 #include "cllGravity.h"
+#include "cllExecutorPool.h"
+#include "cllFramePacer.h"
+#include "cllExport.h"
 
 #include <GL/gl.h>
 #include <GL/glut.h>
@@ -43,16 +47,28 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <CL/cl.hpp>
 
 #include <cstring>
-#include <ctime>
 
 static const unsigned FPS = 30;
-static const clock_t STEP = CLOCKS_PER_SEC/FPS;
-static const float CONVERT = 1000.f/(float)CLOCKS_PER_SEC;
 static const unsigned int NUM_PARTICLES = 100000;
-static const float DT = 1.f/(float)NUM_PARTICLES;
-static const float PI2 = 2.f*3.14f;
+static const unsigned int MIN_PARTICLES = NUM_PARTICLES/100; //floor for the adaptive budget
+static const unsigned int NUM_SYSTEMS = 1; //independent particle systems, NUM_PARTICLES each
+static const unsigned int NUM_WORKERS = 4; //threads driving the systems if there is more than one
+static const bool ADAPTIVE = false; //toggle at runtime with 'a'
+static const bool REPORT_BANDWIDTH = false; //seeding throughput, measures a 2x64MB stream copy baseline at startup
+static const cll::Seed::distribution DISTRIBUTION = cll::Seed::DISK;
+static const cll::Seed::where SEED_ON = cll::Seed::DEVICE;
+static const unsigned int SEED = 0;
 static const float INIT_VEL = 0.f;
+static const cll::Gravity::integrator_t INTEGRATOR = cll::Gravity::EULER; //cycle at runtime with 'i'
+static const float DT = 1.f; //simulated time per frame, split in SUBSTEPS kernel launches
+static const unsigned int SUBSTEPS = 1;
+static const unsigned int ENERGY_EVERY = FPS*SUBSTEPS; //substeps between energy diagnostics, 0 disables them
+static const unsigned int EXPORT_EVERY = 0; //rendered frames between exports of all systems, 0 disables the export
+static const char* const EXPORT_PATH = "particles.cllp";
+static const unsigned int EXPORT_FLAGS = cll::Exporter::DELTA | cll::Exporter::LZ4;
 static const GLfloat POINT_SIZE = 5.f;
+static const bool CULL = true; //draw only what is in the frustum, toggle at runtime with 'c'
+static const float LOD_OVERDRAW = 0.f; //points stacked per point sized area before thinning out, 0 disables lod
 static GLsizei windowWidth = 768;
 static GLsizei windowHeight = 768;
 static GLfloat translateZ = -1.f;
@@ -64,25 +80,32 @@ static void appDestroy(void);
 static void appKeyboard(const unsigned char, const int, const int);
 static void timerCB(const int);
 static void appMouse(int, int, int, int);
-
-static inline float rand_float(const float mn, const float mx)
-{
-    float r = random() / (float) RAND_MAX;
-    return mn + (mx-mn)*r;
-}
+static cl_float16 view_projection(void);
+static GLsizei drawn_count(const cll::Gravity::data_t&);
 
 typedef std::tr1::shared_ptr< cll::Executor<cll::Gravity> > exec_ptr_t;
 static exec_ptr_t exec_gravity;
 
+typedef std::tr1::shared_ptr< cll::ExecutorPool<cll::Gravity> > pool_ptr_t;
+static pool_ptr_t exec_pool;
+
 typedef std::tr1::shared_ptr< cll::Gravity::data_t > data_ptr_t;
-static data_ptr_t gravity_data;
+static std::vector<data_ptr_t> gravity_data;
+
+typedef std::tr1::shared_ptr< cll::Exporter > export_ptr_t;
+static export_ptr_t exporter;
+
+static cll::FramePacer pacer(FPS, NUM_PARTICLES, MIN_PARTICLES);
 
 //dependency injection of v_host vector... for efficient sharing
 //yeah kinda stupid, but i wanted to try it ;)
-std::vector<cl_float4>& inj_v_host()
+cll::HostArray<cl_float4>& inj_v_host(unsigned int system)
 {
-    static std::vector<cl_float4> v_host(NUM_PARTICLES);
-    return v_host;
+    typedef std::tr1::shared_ptr< cll::HostArray<cl_float4> > v_host_ptr_t;
+    static std::vector<v_host_ptr_t> v_host;
+    while(v_host.size() <= system)
+        v_host.push_back(v_host_ptr_t(new cll::HostArray<cl_float4>(NUM_PARTICLES)));
+    return *v_host[system];
 }
 
 struct inj_ident_t {};
@@ -91,37 +114,52 @@ int main(int argc, char** argv)
 {
     init_gl(argc, argv);
 
-    std::vector<cl_float4> pos(NUM_PARTICLES);
-    std::vector<cl_float4>& vel = inj_v_host();
-    float t;
-    std::vector<cl_float4>::iterator pit, vit;
-    for(pit = pos.begin(), vit = vel.begin(), t=0.f;
-        pit<pos.end();
-        ++pit, ++vit, t+=DT)
+    //first, with EXPORT_PATH "-" it moves all further output to stderr
+    if(EXPORT_EVERY)
+        exporter = export_ptr_t(new cll::Exporter(EXPORT_PATH, NUM_SYSTEMS*NUM_PARTICLES, EXPORT_EVERY, EXPORT_FLAGS));
+
+    exec_gravity = exec_ptr_t(new exec_ptr_t::element_type());
+
+    const cl_float16 mvp = view_projection();
+    const GLsizei cell_w = windowWidth/cll::Cull::DEFAULT_GRID;
+    const GLsizei cell_h = windowHeight/cll::Cull::DEFAULT_GRID;
+
+    for(unsigned int i=0; i<NUM_SYSTEMS; ++i)
     {
-        //distribute the particles in a random circle around z axis
-        const float rad = rand_float(.1f, .95f);
-        float dxy = std::cos(PI2 * t);
-        //c++0x has problems with the cl_float4 union somehow
-        vit->s[0] = dxy*INIT_VEL;
-        pit->s[0] = rad*dxy;
-
-        dxy = std::sin(PI2 * t);
-        vit->s[1] = dxy*INIT_VEL;
-        pit->s[1] = rad*dxy;
-
-        vit->s[2] = INIT_VEL;
-        pit->s[2] = rad-0.5f;
-        vit->s[3] = 1.f;
-        pit->s[3] = 1.f;
+        cll::Seed seed(DISTRIBUTION, SEED_ON, SEED+i);
+        seed.init_vel = INIT_VEL;
+        gravity_data.push_back(data_ptr_t(new data_ptr_t::element_type(NUM_PARTICLES, std::tr1::bind(inj_v_host, i), seed)));
+        gravity_data.back()->integrator = INTEGRATOR;
+        gravity_data.back()->dt = DT/SUBSTEPS;
+        gravity_data.back()->substeps = SUBSTEPS;
+        gravity_data.back()->energy_every = ENERGY_EVERY;
+
+        cll::Cull& cull = gravity_data.back()->cull;
+        cull.enabled = CULL;
+        cull.mvp = mvp;
+        cull.slack = POINT_SIZE/std::min(windowWidth, windowHeight); //half a point, in ndc
+        cull.cap = LOD_OVERDRAW*cell_w*cell_h/(POINT_SIZE*POINT_SIZE);
+        exec_gravity->load(gravity_data.back());
+    }
+    if(REPORT_BANDWIDTH)
+    {
+        double ms = 0.;
+        for(unsigned int i=0; i<gravity_data.size(); ++i)
+            ms += gravity_data[i]->seed_ms;
+        const std::size_t bytes = 3*NUM_SYSTEMS*NUM_PARTICLES*sizeof(cl_float4);
+
+        //the stream copy baseline is host memory, it says nothing about the device
+        if(SEED_ON == cll::Seed::HOST)
+            cll::host::report_bandwidth(std::cout, "seed (host)", bytes, ms);
+        else
+            std::cout << "seed (device): " << bytes/(1024*1024) << "MB in " << ms << "ms, "
+                      << (ms > 0. ? bytes/(ms*1000.) : 0.) << "MB/s" << std::endl;
     }
-    cl_float4 colorv = {{1.0f, 0.0f, 0.0f, 1.0f}};
-    std::vector<cl_float4> color(NUM_PARTICLES, colorv);
 
-    gravity_data = data_ptr_t(new data_ptr_t::element_type(pos, inj_v_host, color));
-    exec_gravity = exec_ptr_t(new exec_ptr_t::element_type());
-    exec_gravity->load(gravity_data);
+    if(NUM_SYSTEMS > 1)
+        exec_pool = pool_ptr_t(new pool_ptr_t::element_type(*exec_gravity, NUM_WORKERS));
 
+    pacer.set_adaptive(ADAPTIVE);
     glutMainLoop();
 }
 
@@ -136,7 +174,7 @@ static void init_gl(int argc, char** argv)
 
 
     std::ostringstream ss;
-    ss << "Gravity with OpenCL/OpenGL, using " << NUM_PARTICLES << " particles" << std::ends;
+    ss << "Gravity with OpenCL/OpenGL, using " << NUM_SYSTEMS << "x" << NUM_PARTICLES << " particles" << std::ends;
     glutWindowHandle = glutCreateWindow(ss.str().c_str());
 
     glutDisplayFunc(appRender); //main rendering function
@@ -166,11 +204,34 @@ static void init_gl(int argc, char** argv)
 
 static void appRender(void)
 {
-    clock_t endwait = clock() + STEP;
+    pacer.begin_frame();
+    for(unsigned int i=0; i<gravity_data.size(); ++i)
+        gravity_data[i]->n_active = pacer.budget();
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    exec_gravity->exec(gravity_data);
+    if(exec_pool)
+    {
+        //the workers can't sync with gl themselves
+        glFinish();
+        for(unsigned int i=0; i<gravity_data.size(); ++i)
+            if(!exec_pool->submit(*gravity_data[i]))
+                exec_gravity->exec(gravity_data[i]);
+        exec_pool->wait();
+    }
+    else
+    {
+        for(unsigned int i=0; i<gravity_data.size(); ++i)
+            exec_gravity->exec(gravity_data[i]);
+    }
+    if(exporter)
+    {
+        std::vector<GLuint> vbos;
+        for(unsigned int i=0; i<gravity_data.size(); ++i)
+            vbos.push_back(gravity_data[i]->p_vbo->id());
+        exporter->step(vbos);
+    }
+    pacer.end_compute();
 
     //render the particles from VBOs
     glEnable(GL_BLEND);
@@ -178,39 +239,86 @@ static void appRender(void)
     glEnable(GL_POINT_SMOOTH);
     glPointSize(POINT_SIZE);
 
-    //printf("color buffer\n");
-    glBindBuffer(GL_ARRAY_BUFFER, gravity_data->c_vbo->id());
-    glColorPointer(4, GL_FLOAT, 0, 0);
-
-    //printf("vertex buffer\n");
-    glBindBuffer(GL_ARRAY_BUFFER, gravity_data->p_vbo->id());
-    glVertexPointer(4, GL_FLOAT, 0, 0);
-
     //printf("enable client state\n");
     glEnableClientState(GL_VERTEX_ARRAY);
     glEnableClientState(GL_COLOR_ARRAY);
 
-    //printf("draw arrays\n");
-    glDrawArrays(GL_POINTS, 0, gravity_data->p_vbo->nelem());
+    for(unsigned int i=0; i<gravity_data.size(); ++i)
+    {
+        //printf("color buffer\n");
+        glBindBuffer(GL_ARRAY_BUFFER, gravity_data[i]->c_vbo->id());
+        glColorPointer(4, GL_FLOAT, 0, 0);
+
+        //printf("vertex buffer\n");
+        glBindBuffer(GL_ARRAY_BUFFER, gravity_data[i]->p_vbo->id());
+        glVertexPointer(4, GL_FLOAT, 0, 0);
+
+        if(gravity_data[i]->cull.enabled)
+        {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gravity_data[i]->i_vbo->id());
+            if(gravity_data[i]->d_vbo)
+            {
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gravity_data[i]->d_vbo->id());
+                glDrawElementsIndirect(GL_POINTS, GL_UNSIGNED_INT, 0);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            }
+            else
+                glDrawElements(GL_POINTS, gravity_data[i]->n_drawn, GL_UNSIGNED_INT, 0);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        }
+        else
+        {
+            //printf("draw arrays\n");
+            glDrawArrays(GL_POINTS, 0, gravity_data[i]->n_active);
+        }
+    }
 
     //printf("disable stuff\n");
     glDisableClientState(GL_COLOR_ARRAY);
     glDisableClientState(GL_VERTEX_ARRAY);
 
+    //cl_exec does a glFinish anyway, doing it here lets us time the draw
+    glFinish();
+    pacer.end_draw();
+
     glutSwapBuffers();
 
-    clock_t done = clock();
-    if(done < endwait)
-        glutTimerFunc((float)(endwait-done)*CONVERT, timerCB, 0);
-    else
+    glutTimerFunc(pacer.next_delay(), timerCB, 0);
+    if(pacer.report(std::cout, gravity_data.size()*SUBSTEPS))
+    {
+        unsigned long long drawn = 0;
+        unsigned long long simulated = 0;
+        for(unsigned int i=0; i<gravity_data.size(); ++i)
+        {
+            drawn += drawn_count(*gravity_data[i]);
+            simulated += gravity_data[i]->n_active;
+        }
+        std::cout << "drawn: " << drawn << "/" << simulated << " particles" << std::endl;
+    }
+    if(exporter)
+        exporter->report(std::cout);
+
+    static std::vector<unsigned long long> energy_step(gravity_data.size(), 0);
+    for(unsigned int i=0; i<gravity_data.size(); ++i)
     {
-        std::cout << "perf!!!" << std::endl;
-        glutTimerFunc(0, timerCB, 0);
+        const cll::Gravity::energy_t& e = gravity_data[i]->energy;
+        if(e.step == energy_step[i])
+            continue;
+        energy_step[i] = e.step;
+        std::cout << "energy";
+        if(gravity_data.size() > 1)
+            std::cout << "[" << i << "]";
+        std::cout << " @" << e.step << ": kinetic " << e.kinetic << " potential " << e.potential
+                  << " total " << e.kinetic + e.potential << std::endl;
     }
 }
 
 static void appDestroy(void)
 {
+    //flush pending frames while the gl context is still around
+    exporter.reset();
+    exec_pool.reset();
+
     //this makes sure we properly cleanup our OpenCL context
     if(glutWindowHandle)
         glutDestroyWindow(glutWindowHandle);
@@ -231,6 +339,18 @@ static void appKeyboard(const unsigned char key, const int, const int)
             // Cleanup up and quit
             appDestroy();
             break;
+        case 'a': // a toggles the adaptive particle budget
+            pacer.set_adaptive(!pacer.adaptive());
+            break;
+        case 'i': // i cycles through the integrators
+            for(unsigned int i=0; i<gravity_data.size(); ++i)
+                gravity_data[i]->integrator = (cll::Gravity::integrator_t)((gravity_data[i]->integrator + 1) % (cll::Gravity::RK4 + 1));
+            std::cout << "integrator: " << gravity_data[0]->integrator << std::endl;
+            break;
+        case 'c': // c toggles culling
+            for(unsigned int i=0; i<gravity_data.size(); ++i)
+                gravity_data[i]->cull.enabled = !gravity_data[i]->cull.enabled;
+            break;
     }
 }
 
@@ -241,10 +361,43 @@ static void timerCB(const int)
 
 void appMouse(int button, int, int x, int y)
 {
-    gravity_data->m_pos.s[0] = 2.f*((GLfloat)x/(GLfloat)windowWidth - 0.5f);
-    gravity_data->m_pos.s[1] = -2.f*((GLfloat)y/(GLfloat)windowHeight - 0.5f);
+    cl_float4& mouse = gravity_data[0]->m_pos;
+    mouse.s[0] = 2.f*((GLfloat)x/(GLfloat)windowWidth - 0.5f);
+    mouse.s[1] = -2.f*((GLfloat)y/(GLfloat)windowHeight - 0.5f);
     if(button == GLUT_MIDDLE_BUTTON)
-        gravity_data->m_pos.s[2] = -gravity_data->m_pos.s[2];
-    std::cout << "X: " << gravity_data->m_pos.s[0] << " Y: " << gravity_data->m_pos.s[1] << " Z: " << gravity_data->m_pos.s[2] << std::endl;
+        mouse.s[2] = -mouse.s[2];
+    for(unsigned int i=1; i<gravity_data.size(); ++i)
+        gravity_data[i]->m_pos = mouse;
+    std::cout << "X: " << mouse.s[0] << " Y: " << mouse.s[1] << " Z: " << mouse.s[2] << std::endl;
 }
 
+static cl_float16 view_projection(void)
+{
+    GLfloat proj[16];
+    GLfloat view[16];
+    glGetFloatv(GL_PROJECTION_MATRIX, proj);
+    glGetFloatv(GL_MODELVIEW_MATRIX, view);
+
+    //both column major, mvp = proj * view
+    cl_float16 mvp;
+    for(unsigned int c=0; c<4; ++c)
+        for(unsigned int r=0; r<4; ++r)
+        {
+            mvp.s[c*4+r] = 0.f;
+            for(unsigned int k=0; k<4; ++k)
+                mvp.s[c*4+r] += proj[k*4+r]*view[c*4+k];
+        }
+    return mvp;
+}
+
+//with indirect draw the count never leaves the gpu, fetch it for the stats only
+static GLsizei drawn_count(const cll::Gravity::data_t& data)
+{
+    if(!data.cull.enabled || !data.d_vbo)
+        return data.n_drawn;
+    cl_uint n = 0;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, data.d_vbo->id());
+    glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(n), &n);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return n;
+}